@@ -1,4 +1,4 @@
-// gcc -o alpha_channel alpha_channel.c gfx.c -lX11 -lm -O3 -march=native
+// gcc -o alpha_channel alpha_channel.c gfx.c -lX11 -lm -pthread -O3 -march=native
 
 
 #include <stdio.h>
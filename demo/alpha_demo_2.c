@@ -1,4 +1,4 @@
-// gcc -o alpha_demo_2 alpha_demo_2.c gfx.c -lX11 -lm
+// gcc -o alpha_demo_2 alpha_demo_2.c gfx.c -lX11 -lm -pthread
 
 // 
 
@@ -36,7 +36,7 @@ void draw_raster_bars(int width, int height, float time) {
         gfx_double_buffer_fill_rectangle(0, i * bar_height, width, bar_height, r, g, b, a);
     }
     gfx_double_buffer_fill_rectangle(10, 10, 200, 20, 255, 255, 255, 255); // White background for text
-    gfx_string(10, 10, "1. Raster Bars (Classic)");
+    gfx_double_buffer_string(14, 24, "1. Raster Bars (Classic)", 0, 0, 0, 255);
 }
 
 // 2. Sinus Scroller with alpha trail
@@ -55,11 +55,11 @@ void draw_sinus_scroller(int width, int height, float time) {
         int r, g, b, a;
         float alpha_factor = 1.0f - (float)i / message_len * 0.8f; // Alpha trail
         get_rainbow_color_alpha(time + (float)i / message_len * M_PI * 2, alpha_factor, &r, &g, &b, &a);
-        // No direct alpha support for strings, so we use a point-based approximation
-        gfx_double_buffer_point(x, y, r, g, b, a);
+        char letter[2] = {message[i], '\0'};
+        gfx_double_buffer_string(x, y, letter, r, g, b, a);
     }
     gfx_double_buffer_fill_rectangle(10, 40, 250, 20, 255, 255, 255, 255); // White background for text
-    gfx_string(10, 40, "2. Sinus Scroller with Alpha Trail");
+    gfx_double_buffer_string(14, 54, "2. Sinus Scroller with Alpha Trail", 0, 0, 0, 255);
 }
 
 // 3. Starfield with fading stars
@@ -89,7 +89,7 @@ void draw_starfield(int width, int height, float time) {
         gfx_double_buffer_point(stars[i].x, stars[i].y, r, g, b, a);
     }
     gfx_double_buffer_fill_rectangle(10, 70, 220, 20, 255, 255, 255, 255); // White background for text
-    gfx_string(10, 70, "3. Starfield with Fading Stars");
+    gfx_double_buffer_string(14, 84, "3. Starfield with Fading Stars", 0, 0, 0, 255);
 }
 
 // 4. Plasma effect (simplified, alpha blended)
@@ -104,7 +104,7 @@ void draw_plasma(int width, int height, float time) {
         }
     }
     gfx_double_buffer_fill_rectangle(10, 100, 220, 20, 255, 255, 255, 255); // White background for text
-    gfx_string(10, 100, "4. Plasma Effect (Alpha Blended)");
+    gfx_double_buffer_string(14, 114, "4. Plasma Effect (Alpha Blended)", 0, 0, 0, 255);
 }
 
 // 5. Glowing Circles (bloom-like effect using alpha)
@@ -122,7 +122,7 @@ void draw_glow_circles(int width, int height, float time) {
         gfx_double_buffer_fill_circle(x, y, (int)radius, r, g, b, a);
     }
     gfx_double_buffer_fill_rectangle(10, 130, 230, 20, 255, 255, 255, 255); // White background for text
-    gfx_string(10, 130, "5. Glowing Circles (Bloom-like)");
+    gfx_double_buffer_string(14, 144, "5. Glowing Circles (Bloom-like)", 0, 0, 0, 255);
 }
 
 // 6. Moving Rectangles with color cycling
@@ -139,7 +139,7 @@ void draw_moving_rects(int width, int height, float time) {
         gfx_double_buffer_fill_rectangle(x, y, rect_width, rect_height, r, g, b, a);
     }
     gfx_double_buffer_fill_rectangle(10, 160, 180, 20, 255, 255, 255, 255); // White background for text
-    gfx_string(10, 160, "6. Moving Rectangles");
+    gfx_double_buffer_string(14, 174, "6. Moving Rectangles", 0, 0, 0, 255);
 }
 
 int main() {
@@ -1,4 +1,4 @@
-//  gcc -o demo_alpha_channel demo_alpha_channel.c gfx.c -lX11 -lm
+//  gcc -o demo_alpha_channel demo_alpha_channel.c gfx.c -lX11 -lm -pthread
 
 /* demo_alpha_channel.c - Alpha Channel Demo - Demoscene Style - Переписано для gfx.h */
 #include <stdio.h>
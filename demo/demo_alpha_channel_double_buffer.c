@@ -1,4 +1,4 @@
-// gcc -o demo_alpha_channel_double_buffer demo_alpha_channel_double_buffer.c gfx.c -lX11 -lm -O3 -march=native
+// gcc -o demo_alpha_channel_double_buffer demo_alpha_channel_double_buffer.c gfx.c -lX11 -lm -pthread -O3 -march=native
 // 
 // 
 
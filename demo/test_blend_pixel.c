@@ -1,4 +1,4 @@
-// gcc -o test_blend_pixel test_blend_pixel.c gfx.c -lX11 -lm -O3 -march=native
+// gcc -o test_blend_pixel test_blend_pixel.c gfx.c -lX11 -lm -pthread -O3 -march=native
 
 
 #include "gfx.h"
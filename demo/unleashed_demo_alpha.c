@@ -1,4 +1,4 @@
-// gcc -o unleashed_demo_alpha unleashed_demo_alpha.c gfx.c -lX11 -lm
+// gcc -o unleashed_demo_alpha unleashed_demo_alpha.c gfx.c -lX11 -lm -pthread
 
 
 
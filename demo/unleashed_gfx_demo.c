@@ -1,4 +1,4 @@
-// gcc -o unleashed_gfx_demo unleashed_gfx_demo.c gfx.c -lX11 -lm
+// gcc -o unleashed_gfx_demo unleashed_gfx_demo.c gfx.c -lX11 -lm -pthread
 
 #include <stdio.h>
 #include <stdlib.h>
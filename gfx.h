@@ -19,12 +19,40 @@
     06/06/2024 - Optimized gfx_double_buffer_fill_circle and gfx_double_buffer_fill_polygon for faster rendering.
     06/06/2024 - Optimized gfx_double_buffer_fill_ellipse using Midpoint Ellipse Algorithm.
     06/06/2024 - Replaced bubble sort in gfx_double_buffer_fill_polygon with qsort for intersection sorting.
+    10/19/2026 - Added linear, radial and conic gradient fills for the back buffer.
+    10/19/2026 - Added gfx_image objects and copy/alpha/color-key blits into the back buffer.
+    10/19/2026 - Added scaled, rotated and affine blits with nearest and bilinear filtering.
+    10/19/2026 - Switched the back buffer and images to premultiplied alpha; added layer images as drawing targets.
+    10/19/2026 - Added a clip rectangle stack; shapes are clipped once per span and rejected by bounding box.
+    10/19/2026 - Added clipped Bresenham line, polyline and batched segment drawing for the back buffer.
+    10/19/2026 - Added anti-aliased lines and polylines with fractional endpoints and width.
+    10/19/2026 - Added anti-aliased polygon, circle and ellipse fills with exact area coverage.
+    10/19/2026 - Added a stroker for polylines, rectangles, circles and ellipses with joins and caps.
+    10/19/2026 - Added gfx_path with Bezier and arc segments, cached flattening and fill rules.
+    10/19/2026 - Added batched circle and rectangle fills with band bucketing and threads.
+    10/19/2026 - Added parallel per-pixel shading callbacks with an upsampled variant.
+    10/19/2026 - Added a shared work-stealing thread pool for parallel drawing.
+    10/19/2026 - Added an 8-bit indexed back buffer with a palette; swap now converts into a separate XImage.
+    10/19/2026 - Added vectorized swap conversion for 16-bit (with optional dithering) and packed 24-bit visuals.
+    10/19/2026 - Pixel buffers now have 64-byte aligned, padded rows and can use huge pages.
+    10/19/2026 - Added frame capture to Y4M, raw RGBA or an encoder pipe with a bounded queue and writer thread.
+    10/19/2026 - Added non-blocking screenshots to PNG (built-in deflate), PPM and BMP.
+    10/19/2026 - Added memory-mapped PPM/PAM, BMP and TGA loading with zero-copy and parallel batch loads.
+    10/19/2026 - Added texture atlases with skyline packing, handles and LRU page eviction.
+    10/19/2026 - Added client-side bitmap text for the back buffer with an A8 glyph cache and batched strings.
+    10/19/2026 - Added gfx_double_buffer_fill_mask for 8-bit coverage masks with run skipping and SSE2.
+    10/19/2026 - Added back-buffer scrolling with XCopyArea and partial swaps of the exposed strip.
+    10/19/2026 - Clears and opaque fills use SIMD stores, streaming stores beyond the cache and threads for 4K.
+    10/19/2026 - Back-buffer clears are lazy per strip of rows; untouched strips are filled on the server at swap.
 */
 
 
 #ifndef _GFX_H_
 #define _GFX_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 /* ====================================================================== */
 /*                  BASIC GRAPHICS FUNCTIONS DECLARATIONS                */
 /* ====================================================================== */
@@ -294,7 +322,10 @@ void gfx_color_alpha(int r, int g, int b, int a);
 void gfx_double_buffer_fill_polygon(int *x_points, int *y_points, int num_points, int r, int g, int b, int a);
 
 /**
- * @brief Draw a filled ellipse on the back buffer with alpha blending.
+ * @brief Draw a filled ellipse on the back buffer with alpha blending. The pixel at offset
+ *        (dx, dy) from the center is filled when dx^2 ry^2 + dy^2 rx^2 <= rx^2 ry^2 + rx ry (rx + ry) / 2,
+ *        one span per row, so every pixel is blended once. The shape is 2 rx + 1 by 2 ry + 1
+ *        pixels, slightly fuller along the diagonals than the midpoint outline of earlier versions.
  *
  * @param x_center  X-coordinate of the center of the ellipse.
  * @param y_center  Y-coordinate of the center of the ellipse.
@@ -309,6 +340,7 @@ void gfx_double_buffer_fill_ellipse(int x_center, int y_center, int radius_x, in
 
 /**
  * @brief Draw a filled circle on the back buffer with alpha blending - OPTIMIZED version with alpha.
+ *        Uses the ellipse rule with rx = ry = radius: dx^2 + dy^2 <= radius^2 + radius.
  *
  * @param x_center X-coordinate of the center of the circle.
  * @param y_center Y-coordinate of the center of the circle.
@@ -354,6 +386,22 @@ static void gfx_double_buffer_cleanup_xshm();
  */
 void gfx_double_buffer_init();
 
+/**
+ * @brief Set the padding of pixel buffers (back buffer, indexed buffer, images) allocated
+ *        after the call. Rows always start on a 64-byte boundary; the padding is added on
+ *        top so rows do not map to the same cache sets. Call before gfx_double_buffer_init().
+ * @param bytes Extra bytes per row, rounded up to 64, or -1 (default) to pad only rows
+ *        whose size is a multiple of 4 KB.
+ */
+void gfx_double_buffer_set_row_padding(int bytes);
+
+/**
+ * @brief Allocate pixel buffers of 2 MB or more with mmap and advise transparent huge pages,
+ *        which cuts TLB misses for 4K/8K back buffers. Call before gfx_double_buffer_init().
+ * @param enabled Non-zero to use huge pages where the system supports them.
+ */
+void gfx_double_buffer_set_huge_pages(int enabled);
+
 /**
  * @brief Swap the back buffer to the front buffer (visible window).
  *        If using XSHM, it will use XSHM for swapping.
@@ -361,7 +409,43 @@ void gfx_double_buffer_init();
 void gfx_double_buffer_swap();
 
 /**
- * @brief Clear the back buffer to the specified RGB color.
+ * @brief Show only one rectangle of the back buffer; the rest of the window is not touched.
+ *        The cost is proportional to the rectangle, e.g. the strip exposed by a scroll.
+ *
+ * @param x X-coordinate of the rectangle.
+ * @param y Y-coordinate of the rectangle.
+ * @param w Width of the rectangle.
+ * @param h Height of the rectangle.
+ */
+void gfx_double_buffer_swap_rect(int x, int y, int w, int h);
+
+/**
+ * @brief Move the pixels of a rectangle of the back buffer (or the current target image) by
+ *        (dx, dy). The rectangle is intersected with the clip rectangle first and nothing
+ *        outside it changes. The exposed strip keeps its old pixels and should be redrawn.
+ *        On the back buffer the window contents are moved on the X server too, so after a
+ *        swap, scroll, redraw the strip and show just the strip with gfx_double_buffer_swap_rect().
+ *        Parts of the window hidden by other windows are only repaired by the next full swap.
+ *
+ * @param dx Horizontal distance (positive moves right).
+ * @param dy Vertical distance (positive moves down).
+ * @param x  X-coordinate of the rectangle.
+ * @param y  Y-coordinate of the rectangle.
+ * @param w  Width of the rectangle.
+ * @param h  Height of the rectangle.
+ */
+void gfx_double_buffer_scroll(int dx, int dy, int x, int y, int w, int h);
+
+/**
+ * @brief Enable ordered (4x4 Bayer) dithering when swapping to visuals with fewer than
+ *        8 bits per channel, such as RGB565 or RGB555. Off by default.
+ * @param enabled Non-zero to dither, zero to truncate.
+ */
+void gfx_double_buffer_set_dither(int enabled);
+
+/**
+ * @brief Clear the back buffer (or the current target image) to the specified RGB color.
+ *        Only the clip rectangle is filled; with an empty clip stack that is the whole target.
  *
  * @param r Red color component (0-255).
  * @param g Green color component (0-255).
@@ -421,5 +505,1057 @@ void gfx_set_title(const char *title);
  */
 void gfx_double_buffer_cleanup();
 
+/* ====================================================================== */
+/*                  CLIP RECTANGLE FUNCTIONS DECLARATIONS                */
+/* ====================================================================== */
+
+/**
+ * @brief Push a clip rectangle. All gfx_double_buffer_* drawing is limited to the
+ *        intersection of this rectangle with the previously active clip and the target.
+ * @param x The x-coordinate of the top-left corner.
+ * @param y The y-coordinate of the top-left corner.
+ * @param w The width of the clip rectangle.
+ * @param h The height of the clip rectangle.
+ */
+void gfx_double_buffer_push_clip(int x, int y, int w, int h);
+
+/**
+ * @brief Restore the clip rectangle that was active before the last push.
+ */
+void gfx_double_buffer_pop_clip();
+
+/**
+ * @brief Remove all pushed clip rectangles so that the whole target is drawable again.
+ */
+void gfx_double_buffer_reset_clip();
+
+/**
+ * @brief Get the effective clip rectangle (the pushed clip intersected with the target bounds).
+ * @param x Receives the x-coordinate of the top-left corner (may be NULL).
+ * @param y Receives the y-coordinate of the top-left corner (may be NULL).
+ * @param w Receives the width (may be NULL).
+ * @param h Receives the height (may be NULL).
+ */
+void gfx_double_buffer_get_clip(int *x, int *y, int *w, int *h);
+
+/* ====================================================================== */
+/*                  LINE DRAWING FUNCTIONS DECLARATIONS                  */
+/* ====================================================================== */
+
+/**
+ * @brief Draw a line on the back buffer with alpha blending. Both endpoints are drawn.
+ * @param x1 The x-coordinate of the starting point.
+ * @param y1 The y-coordinate of the starting point.
+ * @param x2 The x-coordinate of the ending point.
+ * @param y2 The y-coordinate of the ending point.
+ * @param r The red component of the color (0-255).
+ * @param g The green component of the color (0-255).
+ * @param b The blue component of the color (0-255).
+ * @param a The alpha component of the color (0-255).
+ */
+void gfx_double_buffer_line(int x1, int y1, int x2, int y2, int r, int g, int b, int a);
+
+/**
+ * @brief Draw connected line segments on the back buffer with alpha blending.
+ *        Shared vertices are blended only once, including the first point of a polyline
+ *        closed by repeating it at the end.
+ * @param x_points Array of x-coordinates of the points.
+ * @param y_points Array of y-coordinates of the points.
+ * @param num_points The number of points.
+ * @param r The red component of the color (0-255).
+ * @param g The green component of the color (0-255).
+ * @param b The blue component of the color (0-255).
+ * @param a The alpha component of the color (0-255).
+ */
+void gfx_double_buffer_polyline(const int *x_points, const int *y_points, int num_points, int r, int g, int b, int a);
+
+/**
+ * @brief Draw a batch of independent line segments on the back buffer in one color.
+ * @param segments Array of num_segments * 4 coordinates (x1, y1, x2, y2 per segment).
+ * @param num_segments The number of segments.
+ * @param r The red component of the color (0-255).
+ * @param g The green component of the color (0-255).
+ * @param b The blue component of the color (0-255).
+ * @param a The alpha component of the color (0-255).
+ */
+void gfx_double_buffer_lines(const int *segments, int num_segments, int r, int g, int b, int a);
+
+/**
+ * @brief Draw an anti-aliased line on the back buffer. Endpoints may be fractional
+ *        (pixel centers are at .5) and the ends are cut square at the endpoints.
+ * @param x1 The x-coordinate of the starting point.
+ * @param y1 The y-coordinate of the starting point.
+ * @param x2 The x-coordinate of the ending point.
+ * @param y2 The y-coordinate of the ending point.
+ * @param width The line width in pixels (1.0 for a hairline).
+ * @param r The red component of the color (0-255).
+ * @param g The green component of the color (0-255).
+ * @param b The blue component of the color (0-255).
+ * @param a The alpha component of the color (0-255).
+ */
+void gfx_double_buffer_line_aa(float x1, float y1, float x2, float y2, float width, int r, int g, int b, int a);
+
+/**
+ * @brief Draw an anti-aliased curve through connected points on the back buffer. The
+ *        segments are filled in one pass with beveled corners, so translucent curves do
+ *        not darken where segments meet.
+ * @param x_points Array of x-coordinates of the points.
+ * @param y_points Array of y-coordinates of the points.
+ * @param num_points The number of points.
+ * @param width The line width in pixels.
+ * @param r The red component of the color (0-255).
+ * @param g The green component of the color (0-255).
+ * @param b The blue component of the color (0-255).
+ * @param a The alpha component of the color (0-255).
+ */
+void gfx_double_buffer_polyline_aa(const float *x_points, const float *y_points, int num_points, float width, int r, int g, int b, int a);
+
+/**
+ * @brief Draw a batch of independent anti-aliased segments on the back buffer in one color.
+ * @param segments Array of num_segments * 4 coordinates (x1, y1, x2, y2 per segment).
+ * @param num_segments The number of segments.
+ * @param width The line width in pixels.
+ * @param r The red component of the color (0-255).
+ * @param g The green component of the color (0-255).
+ * @param b The blue component of the color (0-255).
+ * @param a The alpha component of the color (0-255).
+ */
+void gfx_double_buffer_lines_aa(const float *segments, int num_segments, float width, int r, int g, int b, int a);
+
+/* ====================================================================== */
+/*                  ANTI-ALIASED FILL FUNCTIONS DECLARATIONS             */
+/* ====================================================================== */
+
+/**
+ * @brief Draw an anti-aliased filled polygon on the back buffer using exact per-pixel
+ *        area coverage. Vertices may be fractional; self-intersections use the nonzero rule.
+ * @param x_points Array of x-coordinates of the polygon vertices.
+ * @param y_points Array of y-coordinates of the polygon vertices.
+ * @param num_points The number of vertices.
+ * @param r The red component of the color (0-255).
+ * @param g The green component of the color (0-255).
+ * @param b The blue component of the color (0-255).
+ * @param a The alpha component of the color (0-255).
+ */
+void gfx_double_buffer_fill_polygon_aa(const float *x_points, const float *y_points, int num_points, int r, int g, int b, int a);
+
+/**
+ * @brief Draw an anti-aliased filled ellipse on the back buffer.
+ * @param x_center The x-coordinate of the center.
+ * @param y_center The y-coordinate of the center.
+ * @param radius_x The horizontal radius.
+ * @param radius_y The vertical radius.
+ * @param r The red component of the color (0-255).
+ * @param g The green component of the color (0-255).
+ * @param b The blue component of the color (0-255).
+ * @param a The alpha component of the color (0-255).
+ */
+void gfx_double_buffer_fill_ellipse_aa(float x_center, float y_center, float radius_x, float radius_y, int r, int g, int b, int a);
+
+/**
+ * @brief Draw an anti-aliased filled circle on the back buffer.
+ * @param x_center The x-coordinate of the center.
+ * @param y_center The y-coordinate of the center.
+ * @param radius The radius of the circle.
+ * @param r The red component of the color (0-255).
+ * @param g The green component of the color (0-255).
+ * @param b The blue component of the color (0-255).
+ * @param a The alpha component of the color (0-255).
+ */
+void gfx_double_buffer_fill_circle_aa(float x_center, float y_center, float radius, int r, int g, int b, int a);
+
+/* ====================================================================== */
+/*                  STROKE FUNCTIONS DECLARATIONS                        */
+/* ====================================================================== */
+
+/* Line joins */
+#define GFX_JOIN_MITER 0 /**< Sharp corners, beveled when longer than 4 half widths. */
+#define GFX_JOIN_ROUND 1 /**< Rounded corners. */
+#define GFX_JOIN_BEVEL 2 /**< Corners cut off flat. */
+
+/* Line caps */
+#define GFX_CAP_BUTT   0 /**< Ends cut square at the endpoints. */
+#define GFX_CAP_ROUND  1 /**< Half-circle ends. */
+#define GFX_CAP_SQUARE 2 /**< Square ends extending half the width past the endpoints. */
+
+/**
+ * @brief Stroke connected points on the back buffer with anti-aliasing. The whole stroke
+ *        is filled in one pass, so translucent strokes do not darken where pieces overlap.
+ * @param x_points Array of x-coordinates of the points.
+ * @param y_points Array of y-coordinates of the points.
+ * @param num_points The number of points.
+ * @param closed Non-zero to connect the last point back to the first.
+ * @param width The stroke width in pixels.
+ * @param join The join style (GFX_JOIN_MITER, GFX_JOIN_ROUND or GFX_JOIN_BEVEL).
+ * @param cap The cap style for open strokes (GFX_CAP_BUTT, GFX_CAP_ROUND or GFX_CAP_SQUARE).
+ * @param r The red component of the color (0-255).
+ * @param g The green component of the color (0-255).
+ * @param b The blue component of the color (0-255).
+ * @param a The alpha component of the color (0-255).
+ */
+void gfx_double_buffer_stroke_polyline(const float *x_points, const float *y_points, int num_points, int closed, float width, int join, int cap, int r, int g, int b, int a);
+
+/**
+ * @brief Stroke the outline of a rectangle on the back buffer, centered on its edges.
+ * @param x The x-coordinate of the top-left corner.
+ * @param y The y-coordinate of the top-left corner.
+ * @param w The width of the rectangle.
+ * @param h The height of the rectangle.
+ * @param width The stroke width in pixels.
+ * @param join The join style used at the corners.
+ * @param r The red component of the color (0-255).
+ * @param g The green component of the color (0-255).
+ * @param b The blue component of the color (0-255).
+ * @param a The alpha component of the color (0-255).
+ */
+void gfx_double_buffer_stroke_rectangle(float x, float y, float w, float h, float width, int join, int r, int g, int b, int a);
+
+/**
+ * @brief Stroke the outline of a circle on the back buffer.
+ * @param x_center The x-coordinate of the center.
+ * @param y_center The y-coordinate of the center.
+ * @param radius The radius of the circle.
+ * @param width The stroke width in pixels.
+ * @param r The red component of the color (0-255).
+ * @param g The green component of the color (0-255).
+ * @param b The blue component of the color (0-255).
+ * @param a The alpha component of the color (0-255).
+ */
+void gfx_double_buffer_stroke_circle(float x_center, float y_center, float radius, float width, int r, int g, int b, int a);
+
+/**
+ * @brief Stroke the outline of an ellipse on the back buffer.
+ * @param x_center The x-coordinate of the center.
+ * @param y_center The y-coordinate of the center.
+ * @param radius_x The horizontal radius.
+ * @param radius_y The vertical radius.
+ * @param width The stroke width in pixels.
+ * @param r The red component of the color (0-255).
+ * @param g The green component of the color (0-255).
+ * @param b The blue component of the color (0-255).
+ * @param a The alpha component of the color (0-255).
+ */
+void gfx_double_buffer_stroke_ellipse(float x_center, float y_center, float radius_x, float radius_y, float width, int r, int g, int b, int a);
+
+/* ====================================================================== */
+/*                  PATH FUNCTIONS DECLARATIONS                          */
+/* ====================================================================== */
+
+/**
+ * @brief A vector path made of subpaths of lines, Bezier curves and arcs. Curves are
+ *        flattened on first use and the result is cached until the path is modified.
+ */
+typedef struct gfx_path gfx_path;
+
+/* Fill rules */
+#define GFX_FILL_NONZERO  0 /**< Fill areas with a nonzero winding number. */
+#define GFX_FILL_EVEN_ODD 1 /**< Fill areas enclosed an odd number of times. */
+
+/**
+ * @brief Create an empty path.
+ * @return The new path, or NULL on allocation failure.
+ */
+gfx_path *gfx_path_create();
+
+/**
+ * @brief Destroy a path and free its memory.
+ * @param path The path to destroy (may be NULL).
+ */
+void gfx_path_destroy(gfx_path *path);
+
+/**
+ * @brief Remove all segments from a path, keeping its allocated storage for reuse.
+ * @param path The path to reset.
+ */
+void gfx_path_reset(gfx_path *path);
+
+/**
+ * @brief Set the maximum distance between curves and their flattened segments (default 0.2 pixels).
+ * @param path The path.
+ * @param tolerance The flattening tolerance in pixels.
+ */
+void gfx_path_set_tolerance(gfx_path *path, float tolerance);
+
+/**
+ * @brief Start a new subpath at a point.
+ * @param path The path.
+ * @param x The x-coordinate of the point.
+ * @param y The y-coordinate of the point.
+ */
+void gfx_path_move_to(gfx_path *path, float x, float y);
+
+/**
+ * @brief Add a straight segment from the current point.
+ * @param path The path.
+ * @param x The x-coordinate of the end point.
+ * @param y The y-coordinate of the end point.
+ */
+void gfx_path_line_to(gfx_path *path, float x, float y);
+
+/**
+ * @brief Add a quadratic Bezier curve from the current point.
+ * @param path The path.
+ * @param cx The x-coordinate of the control point.
+ * @param cy The y-coordinate of the control point.
+ * @param x The x-coordinate of the end point.
+ * @param y The y-coordinate of the end point.
+ */
+void gfx_path_quad_to(gfx_path *path, float cx, float cy, float x, float y);
+
+/**
+ * @brief Add a cubic Bezier curve from the current point.
+ * @param path The path.
+ * @param c1x The x-coordinate of the first control point.
+ * @param c1y The y-coordinate of the first control point.
+ * @param c2x The x-coordinate of the second control point.
+ * @param c2y The y-coordinate of the second control point.
+ * @param x The x-coordinate of the end point.
+ * @param y The y-coordinate of the end point.
+ */
+void gfx_path_cubic_to(gfx_path *path, float c1x, float c1y, float c2x, float c2y, float x, float y);
+
+/**
+ * @brief Add a circular arc that rounds the corner at (x1, y1) between the lines from the
+ *        current point to (x1, y1) and from (x1, y1) to (x2, y2).
+ * @param path The path.
+ * @param x1 The x-coordinate of the corner.
+ * @param y1 The y-coordinate of the corner.
+ * @param x2 The x-coordinate of a point on the outgoing line.
+ * @param y2 The y-coordinate of a point on the outgoing line.
+ * @param radius The arc radius.
+ */
+void gfx_path_arc_to(gfx_path *path, float x1, float y1, float x2, float y2, float radius);
+
+/**
+ * @brief Close the current subpath with a straight segment back to its start.
+ * @param path The path.
+ */
+void gfx_path_close(gfx_path *path);
+
+/**
+ * @brief Fill a path on the back buffer with anti-aliasing.
+ * @param path The path to fill.
+ * @param fill_rule GFX_FILL_NONZERO or GFX_FILL_EVEN_ODD.
+ * @param r The red component of the color (0-255).
+ * @param g The green component of the color (0-255).
+ * @param b The blue component of the color (0-255).
+ * @param a The alpha component of the color (0-255).
+ */
+void gfx_double_buffer_fill_path(gfx_path *path, int fill_rule, int r, int g, int b, int a);
+
+/**
+ * @brief Stroke every subpath of a path on the back buffer.
+ * @param path The path to stroke.
+ * @param width The stroke width in pixels.
+ * @param join The join style (GFX_JOIN_MITER, GFX_JOIN_ROUND or GFX_JOIN_BEVEL).
+ * @param cap The cap style for open subpaths (GFX_CAP_BUTT, GFX_CAP_ROUND or GFX_CAP_SQUARE).
+ * @param r The red component of the color (0-255).
+ * @param g The green component of the color (0-255).
+ * @param b The blue component of the color (0-255).
+ * @param a The alpha component of the color (0-255).
+ */
+void gfx_double_buffer_stroke_path(gfx_path *path, float width, int join, int cap, int r, int g, int b, int a);
+
+/* ====================================================================== */
+/*                  BATCHED FILL FUNCTIONS DECLARATIONS                  */
+/* ====================================================================== */
+
+/** Pack a straight-alpha color for the batched fills (0xRRGGBBAA). */
+#define GFX_RGBA(r, g, b, a) (((uint32_t)(r) << 24) | ((uint32_t)(g) << 16) | ((uint32_t)(b) << 8) | (uint32_t)(a))
+
+/**
+ * @brief Draw many filled circles on the back buffer in one call. Pixels whose centers lie
+ *        inside a circle are filled; circles are drawn in array order. Large batches are
+ *        rasterized on several threads.
+ * @param x Array of n center x-coordinates.
+ * @param y Array of n center y-coordinates.
+ * @param radius Array of n radii.
+ * @param rgba Array of n colors packed with GFX_RGBA.
+ * @param n The number of circles.
+ */
+void gfx_double_buffer_fill_circles(const float *x, const float *y, const float *radius, const uint32_t *rgba, int n);
+
+/**
+ * @brief Draw many filled rectangles on the back buffer in one call.
+ * @param x Array of n top-left x-coordinates.
+ * @param y Array of n top-left y-coordinates.
+ * @param w Array of n widths.
+ * @param h Array of n heights.
+ * @param rgba Array of n colors packed with GFX_RGBA.
+ * @param n The number of rectangles.
+ */
+void gfx_double_buffer_fill_rectangles(const float *x, const float *y, const float *w, const float *h, const uint32_t *rgba, int n);
+
+/* ====================================================================== */
+/*                  PIXEL SHADER FUNCTIONS DECLARATIONS                  */
+/* ====================================================================== */
+
+/**
+ * @brief Pack a pixel in the back buffer's memory layout for shading kernels.
+ *        Colors are premultiplied: r, g and b must not exceed a (use a = 255 for opaque colors).
+ */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define GFX_PIXEL(r, g, b, a) (((uint32_t)(r) << 24) | ((uint32_t)(g) << 16) | ((uint32_t)(b) << 8) | (uint32_t)(a))
+#else
+#define GFX_PIXEL(r, g, b, a) ((uint32_t)(r) | ((uint32_t)(g) << 8) | ((uint32_t)(b) << 16) | ((uint32_t)(a) << 24))
+#endif
+
+/**
+ * @brief A shading kernel. It must write width pixels (packed with GFX_PIXEL) to row,
+ *        where pixel i lies at (x + i * step, y). Kernels run concurrently on different rows.
+ */
+typedef void (*gfx_shade_fn)(uint32_t *row, int x, int y, int width, int step, void *user);
+
+/**
+ * @brief Compute every pixel of the back buffer (within the clip rectangle) with a kernel.
+ *        Rows are split into bands that run on several threads; pixels are overwritten, not blended.
+ * @param fn The shading kernel, called once per row with step 1.
+ * @param user Pointer passed through to the kernel.
+ */
+void gfx_double_buffer_shade(gfx_shade_fn fn, void *user);
+
+/**
+ * @brief Like gfx_double_buffer_shade, but the kernel only computes every step-th pixel of
+ *        every step-th row and the rest is filled by bilinear interpolation.
+ * @param fn The shading kernel, called for sample rows with the given step.
+ * @param user Pointer passed through to the kernel.
+ * @param step Distance between computed pixels (1 shades every pixel).
+ */
+void gfx_double_buffer_shade_upsampled(gfx_shade_fn fn, void *user, int step);
+
+/* ====================================================================== */
+/*                  THREAD POOL FUNCTIONS DECLARATIONS                   */
+/* ====================================================================== */
+
+/**
+ * @brief Set the number of threads the library uses for parallel work. The pool starts on
+ *        first use and is stopped by gfx_double_buffer_cleanup(). Without a call, the
+ *        GFX_THREADS environment variable or else the number of online CPUs is used.
+ *        Calls from inside a shading kernel or other parallel job are refused.
+ * @param count The thread count (0 = one per CPU, 1 = single-threaded for deterministic debugging).
+ */
+void gfx_set_threads(int count);
+
+/**
+ * @brief Pin the library's worker threads to separate CPUs. Like gfx_set_threads(), this
+ *        cannot be called from inside a parallel job.
+ * @param pin Non-zero to pin, zero to let the scheduler place them (default).
+ */
+void gfx_set_thread_affinity(int pin);
+
+/* ====================================================================== */
+/*                  INDEXED COLOR FUNCTIONS DECLARATIONS                 */
+/* ====================================================================== */
+
+/**
+ * @brief Switch the back buffer to 8-bit indexed mode (or back to RGBA). While enabled,
+ *        gfx_double_buffer_swap() shows the indexed buffer expanded through a 256-entry
+ *        palette. Primitives drawn in one color (clears, points, lines, shapes, paths,
+ *        strokes, batches, masks and text, anti-aliased or not) then write the palette
+ *        index nearest to their color wherever their coverage makes it at least half
+ *        opaque; there is no blending. Blits, gradients and shading produce a color per
+ *        pixel and are refused (with a message on stderr) while the back buffer is indexed;
+ *        draw them into a layer image instead.
+ *        The palette starts as a 3-3-2 color cube (index = rrrgggbb).
+ * @param enabled Non-zero to allocate the indexed buffer (cleared to index 0), zero to free it.
+ */
+void gfx_double_buffer_set_indexed(int enabled);
+
+/**
+ * @brief Set a range of palette entries. Changing the palette recolors the next swap
+ *        without redrawing, which makes palette animation cheap.
+ * @param first The first entry to set (0-255).
+ * @param count The number of entries; first + count must not exceed 256.
+ * @param colors Array of count colors packed with GFX_RGBA (alpha is ignored).
+ */
+void gfx_double_buffer_set_palette(int first, int count, const uint32_t *colors);
+
+/**
+ * @brief Set one palette entry.
+ * @param index The entry to set (0-255).
+ * @param r The red component (0-255).
+ * @param g The green component (0-255).
+ * @param b The blue component (0-255).
+ */
+void gfx_double_buffer_set_palette_color(int index, int r, int g, int b);
+
+/**
+ * @brief Rotate a range of palette entries for color cycling: entry first + i moves to
+ *        first + (i + shift) mod count.
+ * @param first The first entry of the range.
+ * @param count The number of entries in the range.
+ * @param shift Places to rotate by (negative rotates the other way).
+ */
+void gfx_double_buffer_rotate_palette(int first, int count, int shift);
+
+/**
+ * @brief Get the indexed buffer for direct writes, one byte per pixel.
+ * @param stride Receives the bytes per row (may be NULL).
+ * @return The indexed buffer, or NULL when indexed mode is off.
+ */
+unsigned char *gfx_double_buffer_index_data(int *stride);
+
+/**
+ * @brief Fill the indexed buffer (within the clip rectangle) with one index.
+ * @param index The palette index (0-255).
+ */
+void gfx_double_buffer_clear_index(int index);
+
+/**
+ * @brief Set one pixel of the indexed buffer.
+ * @param x The x-coordinate of the pixel.
+ * @param y The y-coordinate of the pixel.
+ * @param index The palette index (0-255).
+ */
+void gfx_double_buffer_point_index(int x, int y, int index);
+
+/**
+ * @brief Fill a rectangle of the indexed buffer with one index.
+ * @param x The x-coordinate of the top-left corner.
+ * @param y The y-coordinate of the top-left corner.
+ * @param w The width of the rectangle.
+ * @param h The height of the rectangle.
+ * @param index The palette index (0-255).
+ */
+void gfx_double_buffer_fill_rectangle_index(int x, int y, int w, int h, int index);
+
+/* ====================================================================== */
+/*                  FRAME CAPTURE FUNCTIONS DECLARATIONS                 */
+/* ====================================================================== */
+
+#define GFX_CAPTURE_Y4M 0 // YUV4MPEG2, 4:2:0 BT.601; readable by ffmpeg, mpv and most encoders
+#define GFX_CAPTURE_RAW 1 // Headerless premultiplied RGBA frames, 4 bytes per pixel
+
+/**
+ * @brief Start recording every frame shown by gfx_double_buffer_swap(). Swap converts the
+ *        frame into a bounded queue and a writer thread does the I/O, so rendering never
+ *        waits for the disk; when the queue is full the frame is dropped and counted.
+ * @param path Output file, or "|command" to pipe the frames into an encoder process
+ *        (for example "|ffmpeg -i - out.mp4").
+ * @param format GFX_CAPTURE_Y4M or GFX_CAPTURE_RAW.
+ * @param fps Frame rate written to the Y4M header (<= 0 for 30).
+ * @param queue_frames Number of frames the queue can hold (<= 0 for 8).
+ * @return 1 on success, 0 on failure.
+ */
+int gfx_double_buffer_capture_start(const char *path, int format, int fps, int queue_frames);
+
+/**
+ * @brief Stop recording: wait for the queued frames to be written and close the output.
+ *        Also called by gfx_double_buffer_cleanup().
+ */
+void gfx_double_buffer_capture_stop();
+
+/**
+ * @brief Get the frame counts of the current or last capture.
+ * @param written Receives the number of frames written (may be NULL).
+ * @param dropped Receives the number of frames dropped (may be NULL).
+ */
+void gfx_double_buffer_capture_stats(int *written, int *dropped);
+
+/* ====================================================================== */
+/*                  SCREENSHOT FUNCTIONS DECLARATIONS                    */
+/* ====================================================================== */
+
+#define GFX_SAVE_PPM 0 // Binary PPM (P6)
+#define GFX_SAVE_BMP 1 // 24-bit BMP
+#define GFX_SAVE_PNG 2 // 8-bit RGB PNG, compressed without zlib
+
+/**
+ * @brief Called when a screenshot has been written. Runs on the save thread.
+ * @param path The path passed to gfx_double_buffer_save().
+ * @param ok 1 if the file was written, 0 on failure.
+ * @param user The pointer given to gfx_double_buffer_set_save_callback().
+ */
+typedef void (*gfx_save_fn)(const char *path, int ok, void *user);
+
+/**
+ * @brief Save the frame currently in the back buffer (or indexed buffer). The frame is
+ *        copied right away; encoding and writing happen on a background thread, so the
+ *        call costs about one copy of the frame. gfx_double_buffer_cleanup() waits for
+ *        saves still in flight.
+ * @param path The file to write.
+ * @param format GFX_SAVE_PPM, GFX_SAVE_BMP or GFX_SAVE_PNG.
+ * @return 1 if the save was started, 0 on failure.
+ */
+int gfx_double_buffer_save(const char *path, int format);
+
+/**
+ * @brief Set the function called after each screenshot has been written (NULL for none).
+ * @param fn The completion callback.
+ * @param user Pointer passed through to the callback.
+ */
+void gfx_double_buffer_set_save_callback(gfx_save_fn fn, void *user);
+
+/* ====================================================================== */
+/*                  GRADIENT FILL FUNCTIONS DECLARATIONS                 */
+/* ====================================================================== */
+
+/**
+ * @brief A color stop of a gradient ramp. Stops must be given in ascending offset order.
+ */
+typedef struct {
+    float offset;   /**< Position along the gradient (0.0 - 1.0). */
+    int r, g, b, a; /**< Stop color and alpha (0-255). */
+} gfx_gradient_stop;
+
+/**
+ * @brief Fill a rectangle on the back buffer with a linear gradient.
+ *        The stops are expanded once into a 256-entry color ramp; pixels before the start
+ *        point or past the end point take the first or last stop color.
+ *
+ * @param x         X-coordinate of the top-left corner of the filled area.
+ * @param y         Y-coordinate of the top-left corner of the filled area.
+ * @param w         Width of the filled area.
+ * @param h         Height of the filled area.
+ * @param x0        X-coordinate where the gradient starts (offset 0.0).
+ * @param y0        Y-coordinate where the gradient starts.
+ * @param x1        X-coordinate where the gradient ends (offset 1.0).
+ * @param y1        Y-coordinate where the gradient ends.
+ * @param stops     Array of color stops.
+ * @param num_stops Number of color stops.
+ */
+void gfx_double_buffer_fill_linear_gradient(int x, int y, int w, int h, float x0, float y0, float x1, float y1, const gfx_gradient_stop *stops, int num_stops);
+
+/**
+ * @brief Fill a rectangle on the back buffer with a radial gradient.
+ *
+ * @param x         X-coordinate of the top-left corner of the filled area.
+ * @param y         Y-coordinate of the top-left corner of the filled area.
+ * @param w         Width of the filled area.
+ * @param h         Height of the filled area.
+ * @param cx        X-coordinate of the gradient center (offset 0.0).
+ * @param cy        Y-coordinate of the gradient center.
+ * @param radius    Distance from the center where the gradient reaches offset 1.0.
+ * @param stops     Array of color stops.
+ * @param num_stops Number of color stops.
+ */
+void gfx_double_buffer_fill_radial_gradient(int x, int y, int w, int h, float cx, float cy, float radius, const gfx_gradient_stop *stops, int num_stops);
+
+/**
+ * @brief Fill a rectangle on the back buffer with a conic gradient that sweeps once around the center.
+ *
+ * @param x           X-coordinate of the top-left corner of the filled area.
+ * @param y           Y-coordinate of the top-left corner of the filled area.
+ * @param w           Width of the filled area.
+ * @param h           Height of the filled area.
+ * @param cx          X-coordinate of the gradient center.
+ * @param cy          Y-coordinate of the gradient center.
+ * @param start_angle Angle in radians where the sweep starts (offset 0.0), clockwise from the +X axis.
+ * @param stops       Array of color stops.
+ * @param num_stops   Number of color stops.
+ */
+void gfx_double_buffer_fill_conic_gradient(int x, int y, int w, int h, float cx, float cy, float start_angle, const gfx_gradient_stop *stops, int num_stops);
+
+/* ====================================================================== */
+/*                  IMAGE FUNCTIONS DECLARATIONS                         */
+/* ====================================================================== */
+
+/**
+ * @brief An RGBA image that can be drawn onto the back buffer, or drawn into as a layer. Opaque type.
+ *        Pixels are stored with premultiplied alpha; all functions taking or returning colors
+ *        use straight (non-premultiplied) RGBA and convert at the call.
+ */
+typedef struct gfx_image gfx_image;
+
+/* Blit modes */
+#define GFX_BLIT_COPY     0 /**< Copy source pixels. The back buffer stays opaque: translucent pixels land as if over black. */
+#define GFX_BLIT_BLEND    1 /**< Source-over alpha blending using each pixel's alpha. */
+#define GFX_BLIT_COLORKEY 2 /**< Copy source pixels, skipping those matching the image's color key. */
+
+/**
+ * @brief Create an image initialized to transparent black.
+ *
+ * @param width  Width of the image in pixels.
+ * @param height Height of the image in pixels.
+ * @return The new image, or NULL on failure.
+ */
+gfx_image *gfx_image_create(int width, int height);
+
+/**
+ * @brief Create an image from 8-bit RGBA pixel data.
+ *
+ * @param rgba   Pixel data, 4 bytes per pixel in R, G, B, A order.
+ * @param width  Width of the image in pixels.
+ * @param height Height of the image in pixels.
+ * @param stride Bytes per row of the source data (0 for tightly packed rows).
+ * @return The new image, or NULL on failure.
+ */
+gfx_image *gfx_image_create_from_rgba(const unsigned char *rgba, int width, int height, int stride);
+
+/**
+ * @brief Release an image and its pixel memory.
+ *
+ * @param img The image to destroy (may be NULL).
+ */
+void gfx_image_destroy(gfx_image *img);
+
+/**
+ * @brief Get the width of an image in pixels.
+ */
+int gfx_image_width(const gfx_image *img);
+
+/**
+ * @brief Get the height of an image in pixels.
+ */
+int gfx_image_height(const gfx_image *img);
+
+/**
+ * @brief Replace all pixels of an image with 8-bit RGBA data.
+ *
+ * @param img    The image to update.
+ * @param rgba   Pixel data, 4 bytes per pixel in R, G, B, A order.
+ * @param stride Bytes per row of the source data (0 for tightly packed rows).
+ */
+void gfx_image_write_rgba(gfx_image *img, const unsigned char *rgba, int stride);
+
+/**
+ * @brief Fill a whole image with one color, e.g. (0, 0, 0, 0) to reset a layer to transparent.
+ *
+ * @param img The image to fill.
+ * @param r   Red color component (0-255).
+ * @param g   Green color component (0-255).
+ * @param b   Blue color component (0-255).
+ * @param a   Alpha component (0-255).
+ */
+void gfx_image_clear(gfx_image *img, int r, int g, int b, int a);
+
+/**
+ * @brief Set a single pixel of an image.
+ *
+ * @param img The image to update.
+ * @param x   X-coordinate of the pixel.
+ * @param y   Y-coordinate of the pixel.
+ * @param r   Red color component (0-255).
+ * @param g   Green color component (0-255).
+ * @param b   Blue color component (0-255).
+ * @param a   Alpha component (0-255).
+ */
+void gfx_image_set_pixel(gfx_image *img, int x, int y, int r, int g, int b, int a);
+
+/**
+ * @brief Read a single pixel of an image. Out-of-range pixels read as transparent black.
+ *
+ * @param img The image to read.
+ * @param x   X-coordinate of the pixel.
+ * @param y   Y-coordinate of the pixel.
+ * @param r   Receives the red component (may be NULL).
+ * @param g   Receives the green component (may be NULL).
+ * @param b   Receives the blue component (may be NULL).
+ * @param a   Receives the alpha component (may be NULL).
+ */
+void gfx_image_get_pixel(const gfx_image *img, int x, int y, int *r, int *g, int *b, int *a);
+
+/**
+ * @brief Set the color that GFX_BLIT_COLORKEY blits treat as transparent.
+ *
+ * @param img The image to update.
+ * @param r   Red component of the key color (0-255).
+ * @param g   Green component of the key color (0-255).
+ * @param b   Blue component of the key color (0-255).
+ */
+void gfx_image_set_color_key(gfx_image *img, int r, int g, int b);
+
+/**
+ * @brief Load an image file: binary PPM/PGM/PAM with 8-bit samples, uncompressed BMP
+ *        (8-bit paletted, 24-bit, 32-bit) or TGA (true-color or grayscale, raw or RLE).
+ *        The file is memory-mapped and converted straight into the back buffer's pixel
+ *        format. An opaque RGBA file whose top-down pixel rows start at a multiple of 4 bytes
+ *        into the file (in practice a PAM file whose header length is a multiple of 4) uses the
+ *        mapping without a copy. Other files, including every BMP at the standard pixel offsets
+ *        (54, 66, 70, 122, 138, all 2 modulo 4), are copied.
+ *
+ * @param path The file to load.
+ * @return The new image, or NULL on failure. Release it with gfx_image_destroy().
+ */
+gfx_image *gfx_image_load(const char *path);
+
+/**
+ * @brief Load several image files in parallel on the library's worker threads.
+ *
+ * @param paths  Array of count file paths.
+ * @param images Array receiving count images (NULL entries for files that failed to load).
+ * @param count  The number of files.
+ * @return The number of images loaded.
+ */
+int gfx_image_load_many(const char *const *paths, gfx_image **images, int count);
+
+/**
+ * @brief Redirect all gfx_double_buffer_* drawing into a layer image instead of the back buffer.
+ *        Drawing into a layer keeps its alpha channel, so a layer can be rendered once and
+ *        composited every frame with gfx_double_buffer_blit(layer, x, y, GFX_BLIT_BLEND, alpha).
+ *        gfx_double_buffer_clear() fills the layer opaquely; use gfx_image_clear() to make it transparent.
+ *
+ * @param img The layer image to draw into, or NULL to draw into the back buffer again.
+ */
+void gfx_double_buffer_set_target(gfx_image *img);
+
+/**
+ * @brief Get the layer image currently being drawn into.
+ *
+ * @return The layer image, or NULL when drawing into the back buffer.
+ */
+gfx_image *gfx_double_buffer_get_target();
+
+/**
+ * @brief Draw an image onto the back buffer, clipped to the buffer.
+ *
+ * @param img   The image to draw.
+ * @param x     X-coordinate of the image's top-left corner on the back buffer.
+ * @param y     Y-coordinate of the image's top-left corner on the back buffer.
+ * @param mode  GFX_BLIT_COPY, GFX_BLIT_BLEND or GFX_BLIT_COLORKEY.
+ * @param alpha Global alpha applied to the whole blit (0-255, 255 = unchanged).
+ */
+void gfx_double_buffer_blit(const gfx_image *img, int x, int y, int mode, int alpha);
+
+/**
+ * @brief Draw a sub-rectangle of an image onto the back buffer, clipped to the buffer.
+ *
+ * @param img   The image to draw.
+ * @param src_x X-coordinate of the sub-rectangle in the image.
+ * @param src_y Y-coordinate of the sub-rectangle in the image.
+ * @param w     Width of the sub-rectangle.
+ * @param h     Height of the sub-rectangle.
+ * @param x     X-coordinate on the back buffer.
+ * @param y     Y-coordinate on the back buffer.
+ * @param mode  GFX_BLIT_COPY, GFX_BLIT_BLEND or GFX_BLIT_COLORKEY.
+ * @param alpha Global alpha applied to the whole blit (0-255, 255 = unchanged).
+ */
+void gfx_double_buffer_blit_region(const gfx_image *img, int src_x, int src_y, int w, int h, int x, int y, int mode, int alpha);
+
+/* Filters for scaled and rotated blits */
+#define GFX_FILTER_NEAREST  0 /**< Nearest-neighbour sampling (blocky, fastest). */
+#define GFX_FILTER_BILINEAR 1 /**< Bilinear interpolation between the four nearest pixels. */
+
+/**
+ * @brief Draw an image mapped through an affine transform onto the back buffer.
+ *        A point (u, v) of the image lands at X = m[0]*u + m[1]*v + m[2], Y = m[3]*u + m[4]*v + m[5].
+ *        Source alpha is blended like GFX_BLIT_BLEND. Images must be smaller than 32768x32768.
+ *
+ * @param img    The image to draw.
+ * @param m      The 2x3 affine matrix, row-major (6 floats).
+ * @param filter GFX_FILTER_NEAREST or GFX_FILTER_BILINEAR.
+ * @param alpha  Global alpha applied to the whole blit (0-255).
+ */
+void gfx_double_buffer_blit_transform(const gfx_image *img, const float *m, int filter, int alpha);
+
+/**
+ * @brief Draw an image stretched to fill a rectangle on the back buffer.
+ *
+ * @param img    The image to draw.
+ * @param x      X-coordinate of the destination rectangle.
+ * @param y      Y-coordinate of the destination rectangle.
+ * @param w      Width of the destination rectangle.
+ * @param h      Height of the destination rectangle.
+ * @param filter GFX_FILTER_NEAREST or GFX_FILTER_BILINEAR.
+ * @param alpha  Global alpha applied to the whole blit (0-255).
+ */
+void gfx_double_buffer_blit_scaled(const gfx_image *img, int x, int y, int w, int h, int filter, int alpha);
+
+/**
+ * @brief Draw an image rotated and scaled about its center.
+ *
+ * @param img    The image to draw.
+ * @param cx     X-coordinate on the back buffer where the image center is placed.
+ * @param cy     Y-coordinate on the back buffer where the image center is placed.
+ * @param angle  Rotation in radians (clockwise on screen).
+ * @param scale  Scale factor (1.0 = original size).
+ * @param filter GFX_FILTER_NEAREST or GFX_FILTER_BILINEAR.
+ * @param alpha  Global alpha applied to the whole blit (0-255).
+ */
+void gfx_double_buffer_blit_rotated(const gfx_image *img, float cx, float cy, float angle, float scale, int filter, int alpha);
+
+/* ====================================================================== */
+/*                  TEXTURE ATLAS FUNCTIONS DECLARATIONS                 */
+/* ====================================================================== */
+
+#define GFX_ATLAS_RGBA 0 // Pages are gfx_images of premultiplied RGBA pixels (sprites)
+#define GFX_ATLAS_A8   1 // Pages are 8-bit coverage masks (glyphs)
+
+/**
+ * @brief Opaque texture atlas: many small rectangles packed onto a few large pages.
+ *
+ * Rectangles are looked up by a 64-bit key chosen by the caller and addressed by an int
+ * handle (0 = none). When a new rectangle does not fit and the memory cap is reached, the
+ * least recently used page is emptied as a whole: its handles stop resolving, and
+ * gfx_atlas_find() returns 0 for their keys, so callers simply re-add what they need.
+ */
+typedef struct gfx_atlas gfx_atlas;
+
+/**
+ * @brief Create an empty atlas. Pages are allocated on demand.
+ *
+ * @param page_width  Width of each page in pixels.
+ * @param page_height Height of each page in pixels.
+ * @param format      GFX_ATLAS_RGBA or GFX_ATLAS_A8.
+ * @param memory_cap  Maximum bytes of page pixels (at least one page is always allowed; 0 = no cap).
+ * @return The new atlas, or NULL on failure.
+ */
+gfx_atlas *gfx_atlas_create(int page_width, int page_height, int format, size_t memory_cap);
+
+/**
+ * @brief Destroy an atlas and all of its pages. Every handle becomes invalid.
+ *
+ * @param atlas The atlas to destroy (NULL is ignored).
+ */
+void gfx_atlas_destroy(gfx_atlas *atlas);
+
+/**
+ * @brief Reserve a rectangle for a key. Its contents are undefined until written through
+ *        gfx_atlas_pixels(). A rectangle already stored for the key is replaced.
+ *
+ * May evict the least recently used page, invalidating handles obtained earlier.
+ *
+ * @param atlas The atlas.
+ * @param key   Caller-chosen identifier (e.g. font, size and glyph packed together).
+ * @param w     Width of the rectangle (must fit a page with a 1-pixel gutter).
+ * @param h     Height of the rectangle.
+ * @return Handle of the rectangle, or 0 on failure.
+ */
+int gfx_atlas_reserve(gfx_atlas *atlas, uint64_t key, int w, int h);
+
+/**
+ * @brief Reserve a rectangle for a key and copy a region of an image into it (RGBA atlases only).
+ *
+ * @param atlas The atlas.
+ * @param key   Caller-chosen identifier.
+ * @param img   Source image.
+ * @param src_x X-coordinate of the region in the image.
+ * @param src_y Y-coordinate of the region in the image.
+ * @param w     Width of the region.
+ * @param h     Height of the region.
+ * @return Handle of the rectangle, or 0 on failure.
+ */
+int gfx_atlas_add_image(gfx_atlas *atlas, uint64_t key, const gfx_image *img, int src_x, int src_y, int w, int h);
+
+/**
+ * @brief Look up the rectangle stored for a key and mark its page as recently used.
+ *
+ * @param atlas The atlas.
+ * @param key   Identifier passed when the rectangle was added.
+ * @return Handle of the rectangle, or 0 if it was never added, removed or evicted.
+ */
+int gfx_atlas_find(gfx_atlas *atlas, uint64_t key);
+
+/**
+ * @brief Get where a handle's rectangle lives. Any output pointer may be NULL.
+ *
+ * @param atlas The atlas.
+ * @param handle Handle returned by gfx_atlas_reserve(), gfx_atlas_add_image() or gfx_atlas_find().
+ * @param page  Receives the page index.
+ * @param x     Receives the X-coordinate of the rectangle on its page.
+ * @param y     Receives the Y-coordinate of the rectangle on its page.
+ * @param w     Receives the width of the rectangle.
+ * @param h     Receives the height of the rectangle.
+ * @return 1 if the handle is valid, 0 if it was removed or evicted.
+ */
+int gfx_atlas_get(gfx_atlas *atlas, int handle, int *page, int *x, int *y, int *w, int *h);
+
+/**
+ * @brief Get a pointer to the first pixel of a handle's rectangle for filling it in.
+ *        RGBA atlases expect premultiplied pixels (4 bytes each), A8 atlases one coverage byte.
+ *
+ * @param atlas  The atlas.
+ * @param handle A valid handle.
+ * @param stride Receives the page's bytes per row.
+ * @return Pointer to the rectangle, or NULL if the handle is invalid.
+ */
+unsigned char *gfx_atlas_pixels(gfx_atlas *atlas, int handle, int *stride);
+
+/**
+ * @brief Get the image backing one page of an RGBA atlas, for use with any blit function.
+ *
+ * @param atlas The atlas.
+ * @param page  Page index from gfx_atlas_get().
+ * @return The page image, or NULL for A8 atlases and out-of-range pages.
+ */
+gfx_image *gfx_atlas_page_image(gfx_atlas *atlas, int page);
+
+/**
+ * @brief Draw a rectangle of an RGBA atlas onto the back buffer.
+ *
+ * @param atlas  The atlas.
+ * @param handle Handle of the rectangle (invalid handles draw nothing).
+ * @param x      X-coordinate of the top-left corner on the back buffer.
+ * @param y      Y-coordinate of the top-left corner on the back buffer.
+ * @param mode   GFX_BLIT_COPY, GFX_BLIT_BLEND or GFX_BLIT_COLORKEY.
+ * @param alpha  Global alpha applied to the whole blit (0-255).
+ */
+void gfx_atlas_blit(gfx_atlas *atlas, int handle, int x, int y, int mode, int alpha);
+
+/**
+ * @brief Remove a rectangle. Its space is reclaimed when its page is next evicted.
+ *
+ * @param atlas  The atlas.
+ * @param handle Handle of the rectangle (invalid handles are ignored).
+ */
+void gfx_atlas_remove(gfx_atlas *atlas, int handle);
+
+/* ====================================================================== */
+/*                  ALPHA MASK FUNCTIONS DECLARATIONS                    */
+/* ====================================================================== */
+
+/**
+ * @brief Fill a color through an 8-bit coverage mask (0 = untouched, 255 = full color).
+ *        The building block for text, soft brushes and shadows: transparent runs of the
+ *        mask are skipped and fully covered runs of an opaque color are plain stores.
+ *
+ * @param mask   Coverage bytes, one per pixel.
+ * @param stride Bytes per mask row (0 = w).
+ * @param w      Width of the mask.
+ * @param h      Height of the mask.
+ * @param x      X-coordinate of the mask's top-left corner on the back buffer.
+ * @param y      Y-coordinate of the mask's top-left corner on the back buffer.
+ * @param rgba   Color packed with GFX_RGBA; its alpha scales the coverage.
+ */
+void gfx_double_buffer_fill_mask(const unsigned char *mask, int stride, int w, int h, int x, int y, uint32_t rgba);
+
+/* ====================================================================== */
+/*                  TEXT FUNCTIONS DECLARATIONS                          */
+/* ====================================================================== */
+
+/**
+ * @brief Select the font of the back-buffer text functions. Every glyph is rasterized once
+ *        into an 8-bit glyph cache, so drawing text costs no X requests.
+ *
+ * Without a call, the first text drawn uses the X core font "fixed" (like gfx_string()), or
+ * the built-in 8x8 font when no display is open.
+ *
+ * @param name X core font name (e.g. "9x15" or an XLFD pattern), or NULL for the built-in 8x8 font.
+ *             Falls back to the built-in font if the font cannot be loaded.
+ */
+void gfx_double_buffer_set_font(const char *name);
+
+/**
+ * @brief Draw a text string on the back buffer (or the current target image), blended with alpha.
+ *
+ * @param x The x-coordinate where the string will start.
+ * @param y The y-coordinate of the baseline.
+ * @param s The string to be drawn (Latin-1; characters the font lacks are skipped).
+ * @param r Red component (0-255).
+ * @param g Green component (0-255).
+ * @param b Blue component (0-255).
+ * @param a Alpha component (0-255).
+ */
+void gfx_double_buffer_string(int x, int y, const char *s, int r, int g, int b, int a);
+
+/**
+ * @brief Draw many strings on the back buffer in one call, in array order. Large batches
+ *        are composited on several threads.
+ * @param x Array of n start x-coordinates.
+ * @param y Array of n baseline y-coordinates.
+ * @param s Array of n strings (NULL entries are skipped).
+ * @param rgba Array of n colors packed with GFX_RGBA.
+ * @param n The number of strings.
+ */
+void gfx_double_buffer_strings(const int *x, const int *y, const char *const *s, const uint32_t *rgba, int n);
+
+/**
+ * @brief Get the width of a text string in pixels using the back-buffer font.
+ *
+ * @param s The null-terminated string to measure.
+ * @return The advance width of the string in pixels (0 for NULL).
+ */
+int gfx_double_buffer_textwidth(const char *s);
+
 #endif /* _GFX_H_ */
 